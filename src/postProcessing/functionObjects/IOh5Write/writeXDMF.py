@@ -14,7 +14,6 @@ __license__ = "GPL v3 or later"
 import h5py
 import numpy
 import math
-import re
 import argparse
 import os
 
@@ -143,31 +142,111 @@ def writeCloud(cloud, fo, args):
     return
 
 
-# Parse and write mesh/fields
-def writeFields(f, fo, args):
-    
-    # Sone useful handles
-    meshTime = list(f['MESH'].keys())[0]
+# Return the path of a dataset in a group, following soft links such that
+# datasets shared between several times are referenced only once
+def datasetPath(group, name):
+    link = group.get(name, getlink=True)
+    if isinstance(link, h5py.SoftLink):
+        return link.path
+    return '{}/{}'.format(group.name, name)
+
+
+# Find number of points, cells and dataset length for each process in the
+# mesh written at a given time
+def readMesh(f, meshTime):
     mesh = f['MESH'][meshTime]
-    fields = f['FIELDS']
+    
+    # The global layout stores one dataset per field, the processor layout
+    # one dataset per processor and field
+    if 'CELLS' in mesh:
+        groups = [mesh]
+    else:
+        groups = [mesh[proc] for proc in mesh]
+    
+    info = {'global': 'CELLS' in mesh, 'procs': [], 'nCells': [],
+            'cellLength': [], 'cellPrec': [], 'nPoints': [], 'cells': [],
+            'points': []}
+    
+    for g in groups:
+        attrs = h5py.AttributeManager(g['CELLS'])
+        
+        info['procs'].append(g.name.split('/')[-1])
+        info['nCells'].append(attrs['nCells'][0])
+        info['cellLength'].append(len(g['CELLS']))
+        info['cellPrec'].append(g['CELLS'].dtype.itemsize)
+        info['nPoints'].append(len(g['POINTS']))
+        info['cells'].append(datasetPath(g, 'CELLS'))
+        info['points'].append(datasetPath(g, 'POINTS'))
+    
+    return info
 
-    # Find number of points, cells and dataset length for each process
-    nProcs = len(mesh)
-    nPoints = [None]*nProcs
-    nCells = [None]*nProcs
-    cellLength = [None]*nProcs
-    procNo = [None]*nProcs
 
-    i = 0
-    for proc in mesh:
-        attrs = h5py.AttributeManager(mesh[proc]['CELLS'])
+# Write topology, geometry and attributes of one uniform grid
+def writeGrid(fo, indent, name, mesh, i, prec, h5Path, fieldGroup):
+    ind = ' '*indent
+    fo.write('{}<Grid Name="{}" Type="Uniform">\n'.format(ind, name))
+    
+    # Geometry definition
+    fo.write('{}  <Topology Type="Mixed" '
+             'NumberOfElements="{}">\n'
+             .format(ind, mesh['nCells'][i]))
+    
+    fo.write('{}    <DataStructure Dimensions="{}" '
+             'NumberType="Int" Precision="{}" Format="HDF" >\n'
+             .format(ind, mesh['cellLength'][i], mesh['cellPrec'][i]))
+    
+    fo.write('{}      {}:{}\n'.format(ind, h5Path, mesh['cells'][i]))
+    fo.write('{}    </DataStructure>\n'.format(ind))
+    fo.write('{}  </Topology>\n'.format(ind))
+    fo.write('{}  <Geometry GeometryType="XYZ">\n'.format(ind))
+    fo.write('{}    <DataStructure Dimensions="{} 3" '
+             'NumberType="Float" Presicion="{}" Format="HDF" >\n'
+             .format(ind, mesh['nPoints'][i], prec))
+    
+    fo.write('{}      {}:{}\n'.format(ind, h5Path, mesh['points'][i]))
+    
+    fo.write('{}    </DataStructure>\n'.format(ind))
+    fo.write('{}  </Geometry>\n'.format(ind))
+    
+    # Loop over all fields
+    for field in fieldGroup:
+        h = fieldGroup[field]
+        nCmp = int(h.size/h.shape[0])
+        
+        fo.write('{}  <Attribute Name="{}" Center="Cell" '
+                 'AttributeType="{}">\n'
+                 .format(ind, field, xdmfAttrTypes[nCmp]))
+        
+        fo.write('{}    <DataStructure Format="HDF" '
+                 'DataType="Float" Precision="{}" '
+                 'Dimensions="{} {}">\n'
+                 .format(ind, prec, mesh['nCells'][i], nCmp))
         
-        procNo[i] = int(re.findall(r'\d+', proc)[0])
-        nCells[i] = attrs['nCells'][0]
-        cellLength[i] = len(mesh[proc]['CELLS'])
-        nPoints[i] = len(mesh[proc]['POINTS'])
+        fo.write('{}      {}:{}\n'.format(ind, h5Path, h.name))
         
-        i += 1
+        fo.write('{}    </DataStructure>\n'.format(ind))
+        fo.write('{}  </Attribute>\n'.format(ind))
+    
+    # Write grid footer
+    fo.write('{}</Grid>\n'.format(ind))
+
+
+# Parse and write mesh/fields
+def writeFields(f, fo, args):
+    
+    # Sone useful handles
+    fields = f['FIELDS']
+    
+    # Read all meshes. For moving meshes a new mesh is written for each
+    # time, where unchanged datasets are soft links to an earlier time.
+    meshNames = list(f['MESH'].keys())
+    meshValues = [float(i) for i in meshNames]
+    meshIndex = numpy.argsort(meshValues)
+    meshes = {}
+    for meshTime in meshNames:
+        meshes[meshTime] = readMesh(f, meshTime)
+    
+    globalLayout = meshes[meshNames[0]]['global']
     
     # Create a list of scalar time values
     timeNames = list(fields.keys())
@@ -175,8 +254,11 @@ def writeFields(f, fo, args):
     timeIndex = numpy.argsort(timeValues)
     
     # Determine the precision of the HDF5 file
-    someFieldName = list(fields[timeNames[0]]['processor0'].keys())[0]
-    prec = fields[timeNames[0]]['processor0'][someFieldName].dtype.itemsize
+    someFields = fields[timeNames[0]]
+    if not globalLayout:
+        someFields = someFields['processor0']
+    someFieldName = list(someFields.keys())[0]
+    prec = someFields[someFieldName].dtype.itemsize
     
     # Find name and path to HDF5-file relative to XDMF-file
     h5Path = os.path.relpath(f.filename, os.path.dirname(fo.name))
@@ -202,67 +284,32 @@ def writeFields(f, fo, args):
         
         timeName = timeNames[index]
         
+        # Use the latest mesh written at or before this time
+        mesh = meshes[meshNames[meshIndex[0]]]
+        for mI in meshIndex:
+            if meshValues[mI] <= timeValues[index] + 1e-8:
+                mesh = meshes[meshNames[mI]]
+        
         fo.write('      <Grid GridType="Collection" '
-                 'CollectionType="Spatial">\n'
-                 .format(timeValues[index]))
+                 'CollectionType="Spatial">\n')
         
         fo.write('        <Time Type="Single" Value="{}" />\n'
                  .format(timeValues[index]))
         
-        # Loop over all processes
-        i = 0
-        for proc in mesh:
-            fo.write('        <Grid Name="time{}-{}" Type="Uniform">\n'
-                     .format(timeValues[index], proc))
-            
-            # Geometry definition
-            fo.write('          <Topology Type="Mixed" '
-                     'NumberOfElements="{}">\n'
-                     .format(nCells[i]))
-            
-            fo.write('            <DataStructure Dimensions="{}" '
-                     'NumberType="Int" Format="HDF" >\n'.format(cellLength[i]))
-            
-            fo.write('              {}:/MESH/{}/{}/CELLS\n'
-                     .format(h5Path, meshTime, proc))
-            fo.write('            </DataStructure>\n')
-            fo.write('          </Topology>\n')
-            fo.write('          <Geometry GeometryType="XYZ">\n')
-            fo.write('            <DataStructure Dimensions="{} 3" '
-                     'NumberType="Float" Presicion="{}" Format="HDF" >\n'
-                     .format(nPoints[i], prec))
-            
-            fo.write('              {}:/MESH/{}/{}/POINTS\n'
-                     .format(h5Path, meshTime, proc))
-            
-            fo.write('            </DataStructure>\n')
-            fo.write('          </Geometry>\n')
-            
-            # Loop over all fields
-            for field in fields[timeName][proc]:
-                h = fields[timeName][proc][field]
-                nCmp = int(h.size/h.shape[0])
-                
-                fo.write('          <Attribute Name="{}" Center="Cell" '
-                         'AttributeType="{}">\n'
-                         .format(field, xdmfAttrTypes[nCmp]))
-                
-                fo.write('            <DataStructure Format="HDF" '
-                         'DataType="Float" Precision="{}" '
-                         'Dimensions="{} {}">\n'
-                         .format(prec, nCells[i], nCmp))
-                
-                fo.write('              {}:/FIELDS/{}/{}/{}\n'
-                         .format(h5Path, timeName, proc, field))
+        # Global layout: a single grid per time
+        if globalLayout:
+            writeGrid(fo, 8, 'time{}'.format(timeValues[index]),
+                      mesh, 0, prec, h5Path, fields[timeName])
+        
+        # Processor layout: loop over all processes
+        else:
+            i = 0
+            for proc in mesh['procs']:
+                writeGrid(fo, 8, 'time{}-{}'.format(timeValues[index], proc),
+                          mesh, i, prec, h5Path, fields[timeName][proc])
                 
-                fo.write('            </DataStructure>\n')
-                fo.write('          </Attribute>\n')
-            
-            # Write processor footer
-            fo.write('        </Grid>\n')
-            
-            # Increment processor counter
-            i += 1
+                # Increment processor counter
+                i += 1
         
         # Write footer for time
         fo.write('      </Grid>\n\n\n')